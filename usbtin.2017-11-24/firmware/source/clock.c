@@ -42,13 +42,13 @@ void clock_init() {
 }
 
 /**
- * Handle clock task. Count milliseconds
+ * Handle clock task. Count milliseconds, catch up if called late
  */
 void clock_process() {
-    if ((unsigned short) (TMR0 - clock_lastclock) > CLOCK_TIMERTICKS_1MS) {
+    while ((unsigned short) (TMR0 - clock_lastclock) >= CLOCK_TIMERTICKS_1MS) {
        clock_lastclock += CLOCK_TIMERTICKS_1MS;
        clock_msticker++;
-       if (clock_msticker > 60000) clock_msticker = 0;
+       if (clock_msticker >= 60000) clock_msticker = 0;
     }
 }
 
@@ -62,10 +62,32 @@ unsigned short clock_getMS() {
 }
 
 /**
- * Reset millisecond counter
+ * Returns the timer ticks elapsed in the current millisecond
+ *
+ * @return timer ticks since last millisecond step (0..CLOCK_TIMERTICKS_1MS-1 if clock is processed)
+ */
+unsigned short clock_getFraction() {
+    return TMR0 - clock_lastclock;
+}
+
+/**
+ * Returns the fraction of the current millisecond in 4 us steps
+ *
+ * @return fraction of current millisecond (0..249)
+ */
+unsigned char clock_getFine() {
+    unsigned short ticks = clock_getFraction();
+    if (ticks >= CLOCK_TIMERTICKS_1MS) ticks = CLOCK_TIMERTICKS_1MS - 1;
+
+    // ticks * 2 / 3 without division (rounds up by one step at most)
+    return (ticks * 171) >> 8;
+}
+
+/**
+ * Reset millisecond counter. Timer 0 keeps running, so time differences
+ * taken by other modules stay valid.
  */
 void clock_reset() {
-    TMR0 = 0;
-    clock_lastclock = 0;
+    clock_lastclock = TMR0;
     clock_msticker = 0;
 }
@@ -31,6 +31,8 @@ extern void clock_init();
 extern void clock_process();
 extern unsigned short clock_getMS();
 extern void clock_reset();
+extern unsigned short clock_getFraction();
+extern unsigned char clock_getFine();
 
 #define CLOCK_TIMERTICKS_1MS 375
 #define CLOCK_TIMERTICKS_100MS 37500
@@ -30,10 +30,12 @@
 #include "clock.h"
 #include "usbtin.h"
 #include "frontend.h"
+#include "profile.h"
 
 unsigned char timestamping = 0;
+unsigned char clocksync_interval = 0;
 
-#define SENDBUFFER_MAXSIZE 8
+#define SENDBUFFER_MAXSIZE 16
 unsigned char sendbuffer[SENDBUFFER_MAXSIZE];
 unsigned char sendbuffer_size = 0;
 unsigned char sendbuffer_tx_pos = 0;
@@ -69,6 +71,19 @@ void sendbuffer_putch(unsigned char ch) {
 
 
 
+/**
+ * Decode one hex character
+ *
+ * @param ch Hex character
+ * @return Nibble value, 0xff if given character is no hex digit
+ */
+unsigned char parseNibble(char ch) {
+    if ((ch >= '0') && (ch <= '9')) return ch - '0';
+    ch |= 0x20; // lower case
+    if ((ch >= 'a') && (ch <= 'f')) return ch - 'a' + 10;
+    return 0xff;
+}
+
 /**
  * Parse hex value of given string
  *
@@ -80,20 +95,31 @@ void sendbuffer_putch(unsigned char ch) {
 unsigned char parseHex(char * line, unsigned char len, unsigned long * value) {
     *value = 0;
     while (len--) {
-        if (*line == 0) return 0;
-        *value <<= 4;
-        if ((*line >= '0') && (*line <= '9')) {
-           *value += *line - '0';
-        } else if ((*line >= 'A') && (*line <= 'F')) {
-           *value += *line - 'A' + 10;
-        } else if ((*line >= 'a') && (*line <= 'f')) {
-           *value += *line - 'a' + 10;
-        } else return 0;
+        unsigned char nibble = parseNibble(*line);
+        if (nibble == 0xff) return 0;
+        *value = (*value << 4) | nibble;
         line++;
     }
     return 1;
 }
 
+/**
+ * Parse byte value of two hex characters. Avoids the 32 bit arithmetic of
+ * parseHex() for the data bytes of transmit commands.
+ *
+ * @param line Input string
+ * @param value Pointer to variable for the resulting decoded value
+ * @return 0 on error, 1 on success
+ */
+unsigned char parseHexByte(char * line, unsigned char * value) {
+    unsigned char high = parseNibble(line[0]);
+    if (high == 0xff) return 0;
+    unsigned char low = parseNibble(line[1]);
+    if (low == 0xff) return 0;
+    *value = (high << 4) | low;
+    return 1;
+}
+
 /**
  * Send given value as hexadecimal string
  *
@@ -166,16 +192,17 @@ unsigned char parseCmd_transmit(char *line) {
     if (!parseHex(&line[1], idlen, &temp)) return 0;
     canmsg.id = temp;
 
-    if (!parseHex(&line[1 + idlen], 1, &temp)) return 0;
-    canmsg.dlc = temp;
+    unsigned char length = parseNibble(line[1 + idlen]);
+    if (length == 0xff) return 0;
+    canmsg.flags.dlc = length;
 
     if (!canmsg.flags.rtr) {
         unsigned char i;
-        unsigned char length = canmsg.dlc;
         if (length > 8) length = 8;
+        char * datapos = &line[idlen + 2];
         for (i = 0; i < length; i++) {
-            if (!parseHex(&line[idlen + 2 + i*2], 2, &temp)) return 0;
-            canmsg.data[i] = temp;
+            if (!parseHexByte(datapos, &canmsg.data[i])) return 0;
+            datapos += 2;
         }
     }
 
@@ -232,6 +259,7 @@ unsigned char parseCmd_writeRegister(char * line) {
 
 /**
  * Interprets given line and set time stamping
+ * (0: off, 1: milliseconds, 2: milliseconds and fraction in 4 us steps)
  *
  * @param line Line string which contains the transmit command
  */
@@ -239,7 +267,8 @@ unsigned char parseCmd_setTimestamping(char * line) {
     
     unsigned long stamping;
     if (parseHex(&line[1], 1, &stamping)) {
-        timestamping = (stamping != 0);
+        if (stamping == 2) timestamping = 2;
+        else timestamping = (stamping != 0);
         return CR;
     }
     
@@ -258,6 +287,54 @@ void frontend_sendErrorflags(unsigned char flags) {
     sendbuffer_putch(CR);
 }
 
+/**
+ * Put usb frame number and latched clock (ms, us) into send buffer
+ */
+void sendClockSync() {
+
+    unsigned short ms, ticks;
+    unsigned short frame = usb_getFrameNumber(&ms, &ticks);
+    unsigned short us = ticks * 8 / 3;
+
+    sendbuffer_putch('Y');
+    sendByteHex(frame >> 8);
+    sendByteHex(frame);
+    sendByteHex(ms >> 8);
+    sendByteHex(ms);
+    sendByteHex(us >> 8);
+    sendByteHex(us);
+}
+
+/**
+ * Send out clock synchronization record
+ */
+void frontend_sendClockSync() {
+
+    sendClockSync();
+    sendbuffer_putch(CR);
+}
+
+/**
+ * Interprets given line and handle clock synchronization requests
+ *
+ * @param line Line string which contains the transmit command
+ */
+unsigned char parseCmd_clockSync(char * line) {
+
+    unsigned long interval;
+    if (line[1] == 0) {
+        sendClockSync();
+        return CR;
+    }
+
+    if (parseHex(&line[1], 1, &interval)) {
+        clocksync_interval = interval;
+        return CR;
+    }
+
+    return BELL;
+}
+
 /**
  * Interprets given line and handle status flag requests
  *
@@ -339,6 +416,149 @@ unsigned char parseCmd_setFilterCode(char * line) {
     return BELL;
 }
 
+/**
+ * Interprets given line and set MCP2515 acceptance mask ('k') or filter ('K')
+ * with full identifier width
+ *
+ * @param line Line string which contains the transmit command
+ */
+unsigned char parseCmd_setAcceptance(char * line) {
+    if (state == STATE_CONFIG)
+    {
+        unsigned long num, extended, id;
+        if (parseHex(&line[1], 1, &num) && parseHex(&line[2], 1, &extended) && parseHex(&line[3], 8, &id) && (extended < 2)) {
+            if (id > (extended ? 0x1FFFFFFF : 0x7FF)) return BELL; // doesn't fit into identifier width
+            if (line[0] == 'k') {
+                if (num < 2) {
+                    mcp2515_set_mask(num, id, extended);
+                    return CR;
+                }
+            } else if (num < 6) {
+                mcp2515_set_filter(num, id, extended);
+                return CR;
+            }
+        }
+    }
+
+    return BELL;
+}
+
+/**
+ * Interprets given line and set usb flush mode
+ *
+ * Mode 0 flushes after every frame (lowest latency), mode 1 flushes if the
+ * oldest pending character reaches the given deadline in microseconds
+ * (optional, 4 hex digits), mode 2 fills complete usb packets (highest
+ * throughput) with a fallback deadline of 10 ms. Every mode change clears
+ * the usb latency statistics.
+ *
+ * @param line Line string which contains the transmit command
+ */
+unsigned char parseCmd_setFlushMode(char * line) {
+
+    unsigned long mode, deadline;
+    if (parseHex(&line[1], 1, &mode)) {
+
+        switch (mode) {
+            case 0x0: // Latency
+                usb_ep1_setFlushTimeout(0);
+                break;
+            case 0x1: // Deadline
+                if (line[2] == 0) deadline = FLUSH_DEADLINE_DEFAULT_US;
+                else if (!parseHex(&line[2], 4, &deadline)) return BELL;
+                usb_ep1_setFlushTimeout(deadline * CLOCK_TIMERTICKS_1MS / 1000);
+                break;
+            case 0x2: // Throughput
+                usb_ep1_setFlushTimeout(10 * CLOCK_TIMERTICKS_1MS);
+                break;
+            default:
+                return BELL;
+        }
+        usb_ep1_clearLatency();
+        return CR;
+    }
+
+    return BELL;
+}
+
+/**
+ * Interprets given line and returns count of given usb latency bin
+ *
+ * @param line Line string which contains the transmit command
+ */
+unsigned char parseCmd_getLatency(char * line) {
+
+    unsigned long bin;
+    if (parseHex(&line[1], 1, &bin) && (bin < USB_LATENCY_BINS)) {
+        unsigned short count = usb_ep1_getLatencyCount(bin);
+        sendbuffer_putch('u');
+        sendByteHex(count >> 8);
+        sendByteHex(count);
+        return CR;
+    }
+
+    return BELL;
+}
+
+/**
+ * Interprets given line and returns receive buffer high-water mark and
+ * endpoint 1 busy count (no argument) or profiling data of given code path
+ * (profiling builds only)
+ *
+ * @param line Line string which contains the transmit command
+ */
+unsigned char parseCmd_getProfile(char * line) {
+
+    if (line[1] == 0) {
+        // summary: receive buffer high-water mark and endpoint 1 busy count
+        unsigned short busy = profile_getEP1Busy();
+        sendbuffer_putch('P');
+        sendByteHex(profile_getHighwater());
+        sendByteHex(busy >> 8);
+        sendByteHex(busy);
+        return CR;
+    }
+
+#if PROFILE
+    unsigned long slot;
+    if (parseHex(&line[1], 1, &slot) && (slot >= PROFILE_FIRST) && (slot <= PROFILE_LAST)) {
+        unsigned short max = profile_getMax(slot);
+        unsigned short avg = profile_getAvg(slot);
+        sendbuffer_putch('P');
+        sendByteHex(max >> 8);
+        sendByteHex(max);
+        sendByteHex(avg >> 8);
+        sendByteHex(avg);
+        return CR;
+    }
+#endif
+
+    return BELL;
+}
+
+#if PROFILE == 2
+
+/**
+ * Interprets given line and returns histogram of given main loop stage
+ *
+ * @param line Line string which contains the transmit command
+ */
+unsigned char parseCmd_getHistogram(char * line) {
+
+    unsigned long slot;
+    if (parseHex(&line[1], 1, &slot) && (slot >= PROFILE_FIRST) && (slot <= PROFILE_LAST)) {
+        unsigned char bin;
+        sendbuffer_putch('H');
+        for (bin = 0; bin < PROFILE_HISTOGRAM_BINS; bin++) {
+            sendByteHex(profile_getHistogram(slot, bin));
+        }
+        return CR;
+    }
+
+    return BELL;
+}
+#endif
+
 /**
  * Interprets given line and jump to bootloader
  *
@@ -385,6 +605,7 @@ unsigned char parseCmd_bootloaderJump(char * line) {
  */
 void parseLine(char * line) {
 
+    profile_begin(profile_start);
     unsigned char result = BELL;
     
     switch (line[0]) {
@@ -501,6 +722,19 @@ void parseLine(char * line) {
 
             }
             break;        
+        case 'c': // Get count of received and loaded transmit messages
+            sendbuffer_putch('c');
+            sendByteHex(mcp2515_rx_count >> 8);
+            sendByteHex(mcp2515_rx_count);
+            sendByteHex(mcp2515_txload_count >> 8);
+            sendByteHex(mcp2515_txload_count);
+            result = CR;
+            break;
+        case 'q': // Get count of free transmit buffers
+            sendbuffer_putch('q');
+            sendbuffer_putch('0' + mcp2515_tx_free());
+            result = CR;
+            break;
         case 'f': // Handle error reporting requests
             result = parseCmd_errorReporting(line);
             break;
@@ -516,6 +750,31 @@ void parseLine(char * line) {
         case 'M': // Set accpetance filter code
             result = parseCmd_setFilterCode(line);
             break;
+        case 'k': // Set MCP2515 acceptance mask
+        case 'K': // Set MCP2515 acceptance filter
+            result = parseCmd_setAcceptance(line);
+            break;
+        case 'Y': // Clock synchronization with usb frame number
+            result = parseCmd_clockSync(line);
+            break;
+        case 'U': // Set usb flush mode
+            result = parseCmd_setFlushMode(line);
+            break;
+        case 'u': // Get usb latency statistics
+            result = parseCmd_getLatency(line);
+            break;
+        case 'P': // Get profiling data
+            result = parseCmd_getProfile(line);
+            break;
+        case 'p': // Reset profiling data
+            profile_reset();
+            result = CR;
+            break;
+#if PROFILE == 2
+        case 'H': // Get profiling histogram
+            result = parseCmd_getHistogram(line);
+            break;
+#endif
         case 'B': // Jump to bootloader
             result = parseCmd_bootloaderJump(line);
             break;
@@ -523,6 +782,8 @@ void parseLine(char * line) {
     }
 
    sendbuffer_putch(result);
+
+   profile_end(PROFILE_PARSE, profile_start);
 }
 
 /**
@@ -570,13 +831,13 @@ char canmsg2ascii_getNextChar(canmsg_t * canmsg, unsigned char * step) {
 
 	// length        
 
-        ch = canmsg->dlc;
+        ch = canmsg->flags.dlc;
         
         ch = ch & 0xF;
         if (ch > 9) ch = ch - 10 + 'A';
         else ch = ch + '0';
 
-        if ((canmsg->dlc == 0) || canmsg->flags.rtr) newstep = RX_STEP_TIMESTAMP;
+        if ((canmsg->flags.dlc == 0) || canmsg->flags.rtr) newstep = RX_STEP_TIMESTAMP;
         else newstep++;
         
     } else if (*step < RX_STEP_TIMESTAMP) {
@@ -592,15 +853,16 @@ char canmsg2ascii_getNextChar(canmsg_t * canmsg, unsigned char * step) {
         else ch = ch + '0';
         
         newstep++;        
-        if (newstep - RX_STEP_DATA == canmsg->dlc*2) newstep = RX_STEP_TIMESTAMP;
+        if (newstep - RX_STEP_DATA == canmsg->flags.dlc*2) newstep = RX_STEP_TIMESTAMP;
         
-    } else if (timestamping && (*step < RX_STEP_CR)) {
+    } else if (timestamping && (*step < RX_STEP_CR) && ((*step < RX_STEP_TIMESTAMP_FINE) || (timestamping == 2))) {
         
         // timestamp
         
         unsigned char i = *step - RX_STEP_TIMESTAMP;
         if (i < 2) ch = (canmsg->timestamp >> 8) & 0xff;
-        else ch = canmsg->timestamp & 0xff;
+        else if (i < 4) ch = canmsg->timestamp & 0xff;
+        else ch = canmsg->timestamp_fine;
         if ((i % 2) == 0) ch = ch >> 4;
         
         ch = ch & 0xF;
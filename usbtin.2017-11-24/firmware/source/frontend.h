@@ -26,18 +26,25 @@
 #ifndef _FRONTEND_
 #define _FRONTEND_
 
+#if PROFILE
+#define LINE_MAXLEN 32 // make room in ram for profiling data, longest command has 26 characters
+#else
 #define LINE_MAXLEN 100
+#endif
 #define BELL 7
 #define CR 13
 #define LR 10
 
+#define FLUSH_DEADLINE_DEFAULT_US 500
+
 #define RX_STEP_TYPE 0
 #define RX_STEP_ID_EXT 1
 #define RX_STEP_ID_STD 6
 #define RX_STEP_DLC 9
 #define RX_STEP_DATA 10
 #define RX_STEP_TIMESTAMP 26
-#define RX_STEP_CR 30
+#define RX_STEP_TIMESTAMP_FINE 30
+#define RX_STEP_CR 32
 #define RX_STEP_FINISHED 0xff
 
 unsigned char transmitStd(char *line);
@@ -47,5 +54,8 @@ void sendbuffer_send();
 unsigned char sendbuffer_isEmpty();
 void sendStatusflags(unsigned char sendeol);
 void frontend_sendErrorflags(unsigned char flags);
+void frontend_sendClockSync();
+
+extern unsigned char clocksync_interval;
 
 #endif
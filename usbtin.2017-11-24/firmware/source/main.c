@@ -34,6 +34,7 @@
 #include "clock.h"
 #include "mcp2515.h"
 #include "frontend.h"
+#include "profile.h"
 #include "usbtin.h"
 
 volatile unsigned char state = STATE_CONFIG;
@@ -70,25 +71,44 @@ void main(void) {
     unsigned char canmsg_buffer_canpos = 0;
     unsigned char canmsg_buffer_usbpos = 0;
     unsigned char rxstep = 0;
+    profile_begin(print_start); // frame output may span several loop passes
+    unsigned char rxprobe_pos = CANMSG_BUFFERSIZE;
+    unsigned short rxprobe_tick = 0;
     
     unsigned short led_lastclock = TMR0;
     unsigned char led_ticker = 0;
     unsigned char reportstatus_timeout = 0;
     unsigned char reportedStatus = 0;
+    unsigned char clocksync_timeout = 0;
 
 
     // main loop
     while (1) {
 
+        profile_stage_begin(stage_start);
+
         // do module processing
         usb_process();
+        profile_lap(PROFILE_STAGE_USB, stage_start);
         clock_process();
+        profile_lap(PROFILE_STAGE_CLOCK, stage_start);
 
         // handles rx interrupt requests of MCP2515 controller: receive message and store it to buffer
         while ((state != STATE_CONFIG) && (mcp2515_getPinstateRX0BF() || mcp2515_getPinstateRX1BF()) && (canmsg_buffer_filled < CANMSG_BUFFERSIZE) && (mcp2515_receive_message(&canmsg_buffer[canmsg_buffer_canpos]))) {
+                // sample arrival time of one frame at a time for usb latency statistics
+                if (rxprobe_pos == CANMSG_BUFFERSIZE) {
+                    rxprobe_pos = canmsg_buffer_canpos;
+                    rxprobe_tick = TMR0;
+                }
                 canmsg_buffer_canpos = (canmsg_buffer_canpos + 1) % CANMSG_BUFFERSIZE;
                 canmsg_buffer_filled++;                            
         }        
+        profile_highwater(canmsg_buffer_filled);
+        profile_lap(PROFILE_STAGE_RX, stage_start);
+
+        if ((!sendbuffer_isEmpty() || (canmsg_buffer_filled > 0)) && !usb_ep1_ready()) {
+            profile_ep1busy();
+        }
 
         if (!sendbuffer_isEmpty() && (rxstep == 0)) {
 
@@ -100,18 +120,27 @@ void main(void) {
 
             // process can messages in receive buffer
             while (usb_ep1_ready() && (canmsg_buffer_filled > 0)) {
-                usb_putch(canmsg2ascii_getNextChar(&canmsg_buffer[canmsg_buffer_usbpos], &rxstep));
+                if (rxstep == 0) profile_restart(print_start);
+                char ch = canmsg2ascii_getNextChar(&canmsg_buffer[canmsg_buffer_usbpos], &rxstep);
+                if ((rxstep == RX_STEP_FINISHED) && (canmsg_buffer_usbpos == rxprobe_pos)) {
+                    usb_ep1_probe(rxprobe_tick);
+                    rxprobe_pos = CANMSG_BUFFERSIZE;
+                }
+                usb_putch(ch);
                 if (rxstep == RX_STEP_FINISHED) {
                     // finished this frame
                     rxstep = 0;
                     canmsg_buffer_usbpos = (canmsg_buffer_usbpos + 1) % CANMSG_BUFFERSIZE;
                     canmsg_buffer_filled--;
+                    profile_end(PROFILE_PRINT, print_start);
                     break;
                 }
             }
 
         }
         
+        profile_lap(PROFILE_STAGE_OUTPUT, stage_start);
+
         // receive characters from virtual serial port and collect the data until end of line is indicated
         while (usb_chReceived() && (rxstep == 0) && sendbuffer_isEmpty()) {
             unsigned char ch = usb_getch();
@@ -126,6 +155,8 @@ void main(void) {
             }
         }
 
+        profile_lap(PROFILE_STAGE_INPUT, stage_start);
+
         // handle error interrupt
         if ((mcp2515_getPinstateInt() || ((reportedStatus != 0) && (reportstatus_timeout == 0))) && (rxstep == 0) && sendbuffer_isEmpty()) {
            
@@ -140,11 +171,20 @@ void main(void) {
            reportstatus_timeout = 20; // 2s
         }
 
+        // periodic clock synchronization report
+        if ((clocksync_interval != 0) && (clocksync_timeout == 0) && (rxstep == 0) && sendbuffer_isEmpty()) {
+            frontend_sendClockSync();
+            clocksync_timeout = clocksync_interval * 10;
+        }
+
+        profile_lap(PROFILE_STAGE_ERROR, stage_start);
+
         // led signaling        
         if ((unsigned short) (TMR0 - led_lastclock) > CLOCK_TIMERTICKS_100MS) {
             led_lastclock += CLOCK_TIMERTICKS_100MS;
             led_ticker++;            
             if (reportstatus_timeout) reportstatus_timeout--;
+            if (clocksync_timeout) clocksync_timeout--;
         }
         if (!selftest) {
             // selftest failed
@@ -162,5 +202,7 @@ void main(void) {
             _delay(1000);
             RESET();
         }
+
+        profile_lap(PROFILE_STAGE_LED, stage_start);
     }
 }
@@ -22,6 +22,7 @@
 #include "usbtin.h"
 #include "clock.h"
 #include "mcp2515.h"
+#include "profile.h"
 
 /** current transmit buffer priority */
 unsigned char txprio = 3;
@@ -29,6 +30,11 @@ unsigned char txprio = 3;
 /** current rollover ping-pong buffer */
 unsigned char current_rx_buffer = 0;
 
+/** count of received messages (wrapping) */
+unsigned short mcp2515_rx_count = 0;
+/** count of messages loaded into a transmit buffer (wrapping), not bus completions */
+unsigned short mcp2515_txload_count = 0;
+
 /**
  * \brief Transmit one byte over SPI bus
  *
@@ -258,6 +264,80 @@ void mcp2515_set_SJA1000_filter_code(unsigned char acr0, unsigned char acr1, uns
 }
 
 
+/**
+ * \brief Write identifier to the four SIDH/SIDL/EID8/EID0 registers at given address
+ *
+ * \param address Address of SIDH register
+ * \param id Identifier (11 or 29 bit)
+ * \param extended 1 if identifier is extended
+ */
+void mcp2515_write_id(unsigned char address, unsigned long id, unsigned char extended) {
+
+    // pull SS to low level
+    MCP2515_SS = 0;
+
+    // write instruction increments address -> all four registers in one go
+    spi_transmit(MCP2515_CMD_WRITE);
+    spi_transmit(address);
+
+    if (extended) {
+        spi_transmit(id >> 21);
+        spi_transmit(((id >> 13) & 0xe0) | ((id >> 16) & 0x03) | 0x08);
+        spi_transmit(id >> 8);
+        spi_transmit(id);
+    } else {
+        spi_transmit(id >> 3);
+        spi_transmit(id << 5);
+        spi_transmit(0);
+        spi_transmit(0);
+    }
+
+    // release SS
+    MCP2515_SS = 1;
+}
+
+/**
+ * \brief Set acceptance mask with full identifier width
+ *
+ * \param mask Mask number (0: RXB0, 1: RXB1)
+ * \param id Mask bits in identifier layout (11 or 29 bit)
+ * \param extended 1 to mask all 29 bits, 0 to mask the 11 bit standard identifier
+ *
+ * This function has only affect if mcp2515 is in configuration mode.
+ */
+void mcp2515_set_mask(unsigned char mask, unsigned long id, unsigned char extended) {
+
+    mcp2515_write_id(mask ? MCP2515_REG_RXM1SIDH : MCP2515_REG_RXM0SIDH, id, extended);
+}
+
+/**
+ * \brief Set acceptance filter with full identifier width
+ *
+ * \param filter Filter number (0..1: RXB0, 2..5: RXB1)
+ * \param id Identifier to accept (11 or 29 bit)
+ * \param extended 1 to match extended frames, 0 to match standard frames
+ *
+ * For standard frames the MCP2515 applies the extended mask bits (EID15..0)
+ * to data bytes 0 and 1. A standard filter therefore clears these bits of
+ * the mask of its receive buffer, so no wanted frame is dropped.
+ *
+ * This function has only affect if mcp2515 is in configuration mode.
+ */
+void mcp2515_set_filter(unsigned char filter, unsigned long id, unsigned char extended) {
+
+    // RXF0..RXF2 at 0x00, 0x04, 0x08, RXF3..RXF5 at 0x10, 0x14, 0x18
+    unsigned char address = filter << 2;
+    if (filter > 2) address += 4;
+
+    mcp2515_write_id(address, id, extended);
+
+    if (!extended) {
+        unsigned char mask = (filter < 2) ? MCP2515_REG_RXM0EID8 : MCP2515_REG_RXM1EID8;
+        mcp2515_write_register(mask, 0);
+        mcp2515_write_register(mask + 1, 0);
+    }
+}
+
 /**
  * \brief Set bit timing registers
  *
@@ -334,13 +414,14 @@ unsigned char mcp2515_rx_status() {
  */
 unsigned char mcp2515_send_message(canmsg_t * p_canmsg) {
 
+    profile_begin(profile_start);
     unsigned char status = mcp2515_read_status();
     unsigned char address;
     unsigned char ctrlreg;
     unsigned char length;
 
     // check length
-    length = p_canmsg->dlc;
+    length = p_canmsg->flags.dlc;
     if (length > 8) length = 8;
     
     // do some priority fiddling to get fifo behavior
@@ -405,9 +486,9 @@ unsigned char mcp2515_send_message(canmsg_t * p_canmsg) {
 
     // length and data
     if (p_canmsg->flags.rtr) {
-        spi_transmit(p_canmsg->dlc | 0x40);
+        spi_transmit(p_canmsg->flags.dlc | 0x40);
     } else {
-        spi_transmit(p_canmsg->dlc);
+        spi_transmit(p_canmsg->flags.dlc);
         unsigned char i;
         for (i = 0; i < length; i++) {
             spi_transmit(p_canmsg->data[i]);
@@ -421,10 +502,29 @@ unsigned char mcp2515_send_message(canmsg_t * p_canmsg) {
 
     // request message to be transmitted
     mcp2515_write_register(ctrlreg, txprio | 0x08);
-        
+    mcp2515_txload_count++;
+
+    profile_end(PROFILE_TRANSMIT, profile_start);
     return 1;
 }
 
+/**
+ * \brief Get count of free transmit buffers
+ *
+ * \return Count of transmit buffers without pending transmit request (0..3)
+ */
+unsigned char mcp2515_tx_free() {
+
+    unsigned char status = mcp2515_read_status();
+    unsigned char free = 3;
+
+    if (status & 0x04) free--; // TXB0REQ
+    if (status & 0x10) free--; // TXB1REQ
+    if (status & 0x40) free--; // TXB2REQ
+
+    return free;
+}
+
 /*
  * \brief Read out one can message from MCP2515
  *
@@ -433,6 +533,7 @@ unsigned char mcp2515_send_message(canmsg_t * p_canmsg) {
  */
 unsigned char mcp2515_receive_message(canmsg_t * p_canmsg) {
 
+    profile_begin(profile_start);
     unsigned char address;    
 
     if (mcp2515_getPinstateRX0BF() && mcp2515_getPinstateRX1BF()) {
@@ -452,6 +553,8 @@ unsigned char mcp2515_receive_message(canmsg_t * p_canmsg) {
     }
 
     // store timestamp
+    clock_process();
+    p_canmsg->timestamp_fine = clock_getFine();
     p_canmsg->timestamp = clock_getMS();        
 
     // pull SS to low level
@@ -470,7 +573,7 @@ unsigned char mcp2515_receive_message(canmsg_t * p_canmsg) {
         p_canmsg->id |= (unsigned long) spi_transmit(0xff) << 8;
         p_canmsg->id |= (unsigned long) spi_transmit(0xff);
         unsigned char dlc = spi_transmit(0xff);
-        p_canmsg->dlc = dlc & 0x0f;
+        p_canmsg->flags.dlc = dlc & 0x0f;
         p_canmsg->flags.rtr = (dlc >> 6) & 0x01;
     } else {
         // standard
@@ -480,13 +583,13 @@ unsigned char mcp2515_receive_message(canmsg_t * p_canmsg) {
         p_canmsg->id |= (unsigned long) sidl >> 5;
         spi_transmit(0xff);
         spi_transmit(0xff);
-        p_canmsg->dlc = spi_transmit(0xff) & 0x0f;
+        p_canmsg->flags.dlc = spi_transmit(0xff) & 0x0f;
     }
 
     // get data
     if (!p_canmsg->flags.rtr) {
         unsigned char i;
-        unsigned char length = p_canmsg->dlc;
+        unsigned char length = p_canmsg->flags.dlc;
         if (length > 8) length = 8;
         for (i = 0; i < length; i++) {
             p_canmsg->data[i] = spi_transmit(0xff);
@@ -503,5 +606,7 @@ unsigned char mcp2515_receive_message(canmsg_t * p_canmsg) {
         current_rx_buffer = 1;
     }
 
+    mcp2515_rx_count++;
+    profile_end(PROFILE_RECEIVE, profile_start);
     return 1;
 }
\ No newline at end of file
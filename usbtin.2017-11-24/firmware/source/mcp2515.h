@@ -93,11 +93,12 @@ typedef struct
     struct {
        unsigned char rtr : 1;		// remote transmit request
        unsigned char extended : 1;	// extended identifier
+       unsigned char dlc : 4;		// data length code (shares the byte to save ram)
     } flags;
 
-    unsigned char dlc;                  // data length code
     unsigned char data[8];		// payload data
     unsigned short timestamp;           // timestamp
+    unsigned char timestamp_fine;       // fraction of timestamp millisecond in 4 us steps
 } canmsg_t;
 
 // function prototypes
@@ -107,9 +108,14 @@ extern void mcp2515_write_register(unsigned char address, unsigned char data);
 extern void mcp2515_bit_modify(unsigned char address, unsigned char mask, unsigned char data);
 extern void mcp2515_set_SJA1000_filter_mask(unsigned char amr0, unsigned char amr1, unsigned char amr2, unsigned char amr3);
 extern void mcp2515_set_SJA1000_filter_code(unsigned char acr0, unsigned char acr1, unsigned char acr2, unsigned char acr3);
+extern void mcp2515_set_mask(unsigned char mask, unsigned long id, unsigned char extended);
+extern void mcp2515_set_filter(unsigned char filter, unsigned long id, unsigned char extended);
 extern unsigned char mcp2515_read_errorflags();
 extern void mcp2515_set_bittiming(unsigned char cnf1, unsigned char cnf2, unsigned char cnf3);
 extern unsigned char mcp2515_send_message(canmsg_t * p_canmsg);
+extern unsigned char mcp2515_tx_free();
+extern unsigned short mcp2515_rx_count;
+extern unsigned short mcp2515_txload_count;
 extern unsigned char mcp2515_rx_status();
 extern unsigned char mcp2515_receive_message(canmsg_t * p_canmsg);
 
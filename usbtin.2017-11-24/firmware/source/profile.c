@@ -0,0 +1,161 @@
+/********************************************************************
+ File: profile.c
+
+ Description:
+ This file contains the profiler functions. Durations of code paths are
+ measured in timer 0 ticks (32 instruction cycles, 2.67 us) and only
+ compiled in if PROFILE is set (make PROFILE=1 for hot paths, make
+ PROFILE=2 for main loop stages). The receive buffer high-water mark and
+ the endpoint 1 busy count are part of every build.
+
+ Authors and Copyright:
+ (c) 2026, bmc::labs
+
+ Device: PIC18F14K50
+ Compiler: Microchip MPLAB XC8 C Compiler V1.44
+
+ License:
+ This file is part of the usb-can project. It is free and unencumbered
+ software released into the public domain (see LICENSE).
+
+ ********************************************************************/
+
+#include <htc.h>
+#include "profile.h"
+
+unsigned char profile_rx_highwater;
+unsigned short profile_ep1_busy;
+
+#if PROFILE
+
+#define PROFILE_SLOTS (PROFILE_LAST - PROFILE_FIRST + 1)
+
+unsigned short profile_max[PROFILE_SLOTS];
+unsigned short profile_avg[PROFILE_SLOTS]; // moving average, scaled by 16
+#if PROFILE == 2
+unsigned char profile_histogram[PROFILE_SLOTS][PROFILE_HISTOGRAM_BINS];
+#endif
+
+/**
+ * Record duration of given code path
+ *
+ * @param slot Profiled code path
+ * @param ticks Duration in timer ticks
+ */
+void profile_record(unsigned char slot, unsigned short ticks) {
+
+    slot -= PROFILE_FIRST;
+
+    if (ticks > profile_max[slot]) profile_max[slot] = ticks;
+
+    // saturate instead of wrapping on long stalls (average of 4095 ticks and more)
+    unsigned short avg = profile_avg[slot];
+    avg -= avg >> 4;
+    if (ticks > 0xffff - avg) avg = 0xffff;
+    else avg += ticks;
+    profile_avg[slot] = avg;
+
+#if PROFILE == 2
+    unsigned char bin;
+    if (ticks < 16) bin = 0;
+    else if (ticks < 128) bin = 1;
+    else if (ticks < 1024) bin = 2;
+    else bin = 3;
+
+    // halve all bins on overflow, keeps the shape of the distribution
+    if (++profile_histogram[slot][bin] == 0xff) {
+        for (bin = 0; bin < PROFILE_HISTOGRAM_BINS; bin++) {
+            profile_histogram[slot][bin] >>= 1;
+        }
+    }
+#endif
+}
+
+/**
+ * Get maximum duration of given code path
+ *
+ * @param slot Profiled code path
+ * @return Maximum duration in timer ticks
+ */
+unsigned short profile_getMax(unsigned char slot) {
+    return profile_max[slot - PROFILE_FIRST];
+}
+
+/**
+ * Get average duration of given code path
+ *
+ * @param slot Profiled code path
+ * @return Moving average (1/16 weight) of duration in timer ticks (saturates at 0x0fff)
+ */
+unsigned short profile_getAvg(unsigned char slot) {
+    return profile_avg[slot - PROFILE_FIRST] >> 4;
+}
+
+#if PROFILE == 2
+/**
+ * Get histogram bin of given main loop stage
+ *
+ * @param slot Profiled main loop stage
+ * @param bin Histogram bin
+ * @return Relative count of durations in given bin
+ */
+unsigned char profile_getHistogram(unsigned char slot, unsigned char bin) {
+    return profile_histogram[slot - PROFILE_FIRST][bin];
+}
+#endif
+#endif
+
+/**
+ * Track high-water mark of can message receive buffer
+ *
+ * @param filled Current fill level
+ */
+void profile_highwater(unsigned char filled) {
+    if (filled > profile_rx_highwater) profile_rx_highwater = filled;
+}
+
+/**
+ * Get high-water mark of can message receive buffer
+ *
+ * @return Maximum fill level
+ */
+unsigned char profile_getHighwater() {
+    return profile_rx_highwater;
+}
+
+/**
+ * Count main loop cycle with pending output but busy endpoint 1
+ */
+void profile_ep1busy() {
+    if (profile_ep1_busy != 0xffff) profile_ep1_busy++;
+}
+
+/**
+ * Get count of main loop cycles with pending output but busy endpoint 1
+ *
+ * @return Count of cycles (saturates at 0xffff)
+ */
+unsigned short profile_getEP1Busy() {
+    return profile_ep1_busy;
+}
+
+/**
+ * Clear all profiling data
+ */
+void profile_reset() {
+    profile_rx_highwater = 0;
+    profile_ep1_busy = 0;
+#if PROFILE
+    unsigned char i;
+    for (i = 0; i < PROFILE_SLOTS; i++) {
+        profile_max[i] = 0;
+        profile_avg[i] = 0;
+#if PROFILE == 2
+        unsigned char bin;
+        for (bin = 0; bin < PROFILE_HISTOGRAM_BINS; bin++) {
+            profile_histogram[i][bin] = 0;
+        }
+#endif
+    }
+#endif
+}
@@ -0,0 +1,84 @@
+/********************************************************************
+ File: profile.h
+
+ Description:
+ This file contains the profiler definitions.
+
+ Authors and Copyright:
+ (c) 2026, bmc::labs
+
+ Device: PIC18F14K50
+ Compiler: Microchip MPLAB XC8 C Compiler V1.44
+
+ License:
+ This file is part of the usb-can project. It is free and unencumbered
+ software released into the public domain (see LICENSE).
+
+ ********************************************************************/
+#ifndef _PROFILE_
+#define _PROFILE_
+
+// profiled code paths (PROFILE=1)
+#define PROFILE_RECEIVE 0       // mcp2515_receive_message()
+#define PROFILE_TRANSMIT 1      // mcp2515_send_message()
+#define PROFILE_PARSE 2         // parseLine()
+#define PROFILE_PRINT 3         // ascii conversion and usb copy of one frame, first to last character
+
+// main loop stages (PROFILE=2)
+#define PROFILE_STAGE_USB 4     // usb_process()
+#define PROFILE_STAGE_CLOCK 5   // clock_process()
+#define PROFILE_STAGE_RX 6      // drain MCP2515 receive buffers
+#define PROFILE_STAGE_OUTPUT 7  // print frames and command responses
+#define PROFILE_STAGE_INPUT 8   // command intake
+#define PROFILE_STAGE_ERROR 9   // error and clock sync reporting
+#define PROFILE_STAGE_LED 10    // led signaling and bootloader switch
+#define PROFILE_NROF 11
+
+// histogram bins (main loop stages only): < 16, < 128, < 1024, >= 1024 ticks
+#define PROFILE_HISTOGRAM_BINS 4
+
+// slots of this build, one build profiles either hot paths or stages to fit into ram
+#if PROFILE == 1
+#define PROFILE_FIRST PROFILE_RECEIVE
+#define PROFILE_LAST PROFILE_PRINT
+#elif PROFILE == 2
+#define PROFILE_FIRST PROFILE_STAGE_USB
+#define PROFILE_LAST PROFILE_STAGE_LED
+#endif
+
+// receive buffer high-water mark and endpoint 1 busy count are part of every build
+extern void profile_highwater(unsigned char filled);
+extern unsigned char profile_getHighwater();
+extern void profile_ep1busy();
+extern unsigned short profile_getEP1Busy();
+extern void profile_reset();
+
+#if PROFILE
+extern void profile_record(unsigned char slot, unsigned short ticks);
+extern unsigned short profile_getMax(unsigned char slot);
+extern unsigned short profile_getAvg(unsigned char slot);
+#endif
+#if PROFILE == 2
+extern unsigned char profile_getHistogram(unsigned char slot, unsigned char bin);
+#endif
+
+#if PROFILE == 1
+#define profile_begin(start) unsigned short start = TMR0
+#define profile_restart(start) start = TMR0
+#define profile_end(slot, start) profile_record(slot, TMR0 - start)
+#else
+#define profile_begin(start)
+#define profile_restart(start)
+#define profile_end(slot, start)
+#endif
+
+#if PROFILE == 2
+#define profile_stage_begin(start) unsigned short start = TMR0
+// next stage starts after recording, so profiler overhead is not added to it
+#define profile_lap(slot, start) { profile_record(slot, TMR0 - start); start = TMR0; }
+#else
+#define profile_stage_begin(start)
+#define profile_lap(slot, start)
+#endif
+
+#endif
@@ -25,6 +25,7 @@
  ********************************************************************/
 #include <htc.h>
 #include "usb_cdc.h"
+#include "clock.h"
 
 
 #define USTAT_EP0_OUT 0x00
@@ -63,6 +64,9 @@
 #define USB_STRING_SERIALNUMBER_SIZE 18
 
 #define EP_BUFFERSIZE_BULK 0x40
+#define EP_BUFFERSIZE_BULK_OUT 0x10
+
+#define USB_FLUSH_TIMEOUT_DEFAULT (CLOCK_TIMERTICKS_1MS / 2) // 500 us
 
 typedef struct
 {
@@ -192,7 +196,7 @@ const unsigned char usb_config_desc[] = {
         DESCR_ENDPOINT,   /* bDescriptorType: Endpoint */
         0x03,   /* bEndpointAddress: (OUT3) */
         0x02,   /* bmAttributes: Bulk */
-        0x08,             /* wMaxPacketSize: */
+        EP_BUFFERSIZE_BULK_OUT, /* wMaxPacketSize: */
         0x00,
         0x00,   /* bInterval: ignore for Bulk transfer */
 /*Endpoint 1 Descriptor*/
@@ -260,26 +264,36 @@ volatile BDT epbd[EPBD_NROF] @ 0x200;
 // 12 BDTs in use -> we can set buffers starting at 0x230
 volatile unsigned char ep0out_buffer[EP_BUFFERSIZE] @ 0x230;
 volatile unsigned char ep0in_buffer[EP_BUFFERSIZE] @ 0x238;
-volatile unsigned char ep2in_buffer[2][EP_BUFFERSIZE] @ 0x240;
-volatile unsigned char ep3out_buffer[2][EP_BUFFERSIZE] @ 0x250;
-volatile unsigned char ep1in_buffer[2][EP_BUFFERSIZE_BULK] @ 0x260;
+volatile unsigned char ep3out_buffer[2][EP_BUFFERSIZE_BULK_OUT] @ 0x250;
+volatile unsigned char ep1in_buffer[2][EP_BUFFERSIZE_BULK] @ 0x270;
+// usb ram above the endpoint buffers is not used by the SIE -> keep latency statistics there
+unsigned short usb_latency[USB_LATENCY_BINS] @ 0x2F0;
+
+// usb ram not used by the SIE: BDTs of disabled ep1 out (0x208) and ep2 out
+// (0x218), ep2 in buffer (0x240, ep2 is never armed and points to ep0 in
+// buffer). Absolute variables are not initialized by the startup code -> see
+// usb_init()
+unsigned short usb_sof_frame @ 0x208;
+unsigned short usb_sof_ms @ 0x20A;
+unsigned short usb_sof_ticks @ 0x20C;
+unsigned short usb_probe_tick @ 0x20E;
+unsigned short usb_flush_timeout @ 0x218;
+unsigned short usb_ep1_filltime @ 0x21A;
+unsigned short usb_sendleft @ 0x21C;
+unsigned char usb_probe_pending @ 0x21E;
+unsigned char dolinecoding @ 0x21F;
+unsigned char usb_ep0status[2] @ 0x240;
+unsigned char usb_config @ 0x242;
+unsigned char configured @ 0x243;
+unsigned char usb_getchpos @ 0x244;
+unsigned char current_ep3_buffer @ 0x245;
+unsigned char linecoding[7] @ 0x248;
+unsigned char usb_setaddress @ 0x24F;
 
 
-unsigned configured = 0;
-unsigned char usb_config = 0;
-unsigned char usb_setaddress = 0;
-unsigned short usb_sendleft = 0;
 const unsigned char * usb_sendbuffer;
-
 unsigned char txbuffer_writepos = 0;
-unsigned char usb_getchpos = 0;
-unsigned char linecoding[7];
-unsigned char dolinecoding = 0;
-
 unsigned char current_ep1_buffer = EVEN;
-unsigned char current_ep3_buffer = EVEN;
-unsigned char nosend_counter = 0;
-unsigned char usb_ep0status[2] = {0, 0};
 
 /**
  * Determine if usb is enumerated and interface is configured
@@ -289,6 +303,19 @@ unsigned char usb_isConfigured() {
     return configured;
 }
 
+/**
+ * Get usb frame number of last start-of-frame and the clock latched with it
+ *
+ * @param ms Pointer to variable for the milliseconds at last start-of-frame
+ * @param ticks Pointer to variable for the timer ticks within this millisecond
+ * @return 11 bit usb frame number
+ */
+unsigned short usb_getFrameNumber(unsigned short * ms, unsigned short * ticks) {
+    *ms = usb_sof_ms;
+    *ticks = usb_sof_ticks;
+    return usb_sof_frame;
+}
+
 /**
  * Determine if serial number is available
  * @return 0 if no number available
@@ -399,6 +426,61 @@ void usb_ep1_flush() {
         epbd[EPBD_EP1_IN_ODD].stat = 0x88;
         current_ep1_buffer = EVEN;
     }    
+
+    if (usb_probe_pending) {
+        // sort latency of probed frame into logarithmic bins (bin 0: < 64 ticks)
+        unsigned short latency = (TMR0 - usb_probe_tick) >> 6;
+        unsigned char bin = 0;
+        while (latency && (bin < USB_LATENCY_BINS - 1)) {
+            latency >>= 1;
+            bin++;
+        }
+        if (usb_latency[bin] != 0xffff) usb_latency[bin]++;
+        usb_probe_pending = 0;
+    }
+}
+
+/**
+ * Set maximum time characters may wait in endpoint 1 buffer before flushing
+ *
+ * @param ticks Flush timeout in timer ticks. 0 flushes on every usb_process call
+ */
+void usb_ep1_setFlushTimeout(unsigned short ticks) {
+    usb_flush_timeout = ticks;
+}
+
+/**
+ * Mark the following character as end of a probed frame. Time from given
+ * arrival tick to submitting the endpoint 1 buffer is put into the latency
+ * statistics. Ignored if there is already a probe pending.
+ *
+ * @param tick Timer value at arrival of the frame
+ */
+void usb_ep1_probe(unsigned short tick) {
+    if (usb_probe_pending) return;
+    usb_probe_tick = tick;
+    usb_probe_pending = 1;
+}
+
+/**
+ * Get count of probed frames in given latency bin
+ *
+ * @param bin Latency bin. Bin n counts latencies below 64 << n timer ticks, last bin counts the rest
+ * @return Count of probed frames (saturates at 0xffff)
+ */
+unsigned short usb_ep1_getLatencyCount(unsigned char bin) {
+    return usb_latency[bin];
+}
+
+/**
+ * Clear latency statistics
+ */
+void usb_ep1_clearLatency() {
+    unsigned char i;
+    for (i = 0; i < USB_LATENCY_BINS; i++) {
+        usb_latency[i] = 0;
+    }
+    usb_probe_pending = 0;
 }
 
 /**
@@ -413,10 +495,10 @@ void usb_putch(unsigned char ch) {
         return;
     }
     
+    if (txbuffer_writepos == 0) usb_ep1_filltime = TMR0;
+
     ep1in_buffer[current_ep1_buffer][txbuffer_writepos] = ch;
     
-    nosend_counter = 0;
-    
     txbuffer_writepos++;
     if (txbuffer_writepos == EP_BUFFERSIZE_BULK) {
         usb_ep1_flush();
@@ -456,7 +538,7 @@ unsigned char usb_getch() {
     unsigned char ch = ep3out_buffer[current_ep3_buffer][usb_getchpos];
     usb_getchpos++;
     if (usb_getchpos == epbd[EPBD_EP3_OUT_EVEN + current_ep3_buffer].cnt) {
-        epbd[EPBD_EP3_OUT_EVEN + current_ep3_buffer].cnt = EP_BUFFERSIZE;
+        epbd[EPBD_EP3_OUT_EVEN + current_ep3_buffer].cnt = EP_BUFFERSIZE_BULK_OUT;
         epbd[EPBD_EP3_OUT_EVEN + current_ep3_buffer].stat = 0x80;
         usb_getchpos = 0;
         
@@ -483,34 +565,34 @@ void usb_init() {
     
     epbd[EPBD_EP1_IN_EVEN].stat = 0x00;
     epbd[EPBD_EP1_IN_EVEN].cnt = EP_BUFFERSIZE_BULK;
-    epbd[EPBD_EP1_IN_EVEN].adrl = 0x60;
+    epbd[EPBD_EP1_IN_EVEN].adrl = 0x70;
     epbd[EPBD_EP1_IN_EVEN].adrh = 0x02;
 
     epbd[EPBD_EP1_IN_ODD].stat = 0x40;
     epbd[EPBD_EP1_IN_ODD].cnt = EP_BUFFERSIZE_BULK;
-    epbd[EPBD_EP1_IN_ODD].adrl = 0xA0;
+    epbd[EPBD_EP1_IN_ODD].adrl = 0xB0;
     epbd[EPBD_EP1_IN_ODD].adrh = 0x02;
 
     
     epbd[EPBD_EP2_IN_EVEN].stat = 0x00;
     epbd[EPBD_EP2_IN_EVEN].cnt = EP_BUFFERSIZE;
-    epbd[EPBD_EP2_IN_EVEN].adrl = 0x40;
+    epbd[EPBD_EP2_IN_EVEN].adrl = 0x38;
     epbd[EPBD_EP2_IN_EVEN].adrh = 0x02;
     
     epbd[EPBD_EP2_IN_ODD].stat = 0x40;
     epbd[EPBD_EP2_IN_ODD].cnt = EP_BUFFERSIZE;
-    epbd[EPBD_EP2_IN_ODD].adrl = 0x48;
+    epbd[EPBD_EP2_IN_ODD].adrl = 0x38;
     epbd[EPBD_EP2_IN_ODD].adrh = 0x02;
 
     
     epbd[EPBD_EP3_OUT_EVEN].stat = 0x80;
-    epbd[EPBD_EP3_OUT_EVEN].cnt = EP_BUFFERSIZE;
+    epbd[EPBD_EP3_OUT_EVEN].cnt = EP_BUFFERSIZE_BULK_OUT;
     epbd[EPBD_EP3_OUT_EVEN].adrl = 0x50;
     epbd[EPBD_EP3_OUT_EVEN].adrh = 0x02;
 
     epbd[EPBD_EP3_OUT_ODD].stat = 0x80;
-    epbd[EPBD_EP3_OUT_ODD].cnt = EP_BUFFERSIZE;
-    epbd[EPBD_EP3_OUT_ODD].adrl = 0x58;
+    epbd[EPBD_EP3_OUT_ODD].cnt = EP_BUFFERSIZE_BULK_OUT;
+    epbd[EPBD_EP3_OUT_ODD].adrl = 0x60;
     epbd[EPBD_EP3_OUT_ODD].adrh = 0x02;
     
     
@@ -519,6 +601,22 @@ void usb_init() {
     UEP2 = 0x1A;
     UEP3 = 0x1C;
 
+    usb_sof_frame = 0;
+    usb_sof_ms = 0;
+    usb_sof_ticks = 0;
+    usb_flush_timeout = USB_FLUSH_TIMEOUT_DEFAULT;
+    usb_ep1_filltime = 0;
+    usb_sendleft = 0;
+    dolinecoding = 0;
+    usb_setaddress = 0;
+    usb_ep0status[0] = 0;
+    usb_ep0status[1] = 0;
+    usb_config = 0;
+    configured = 0;
+    usb_getchpos = 0;
+    current_ep3_buffer = EVEN;
+    usb_ep1_clearLatency();
+
     UCFG = 0x17;
     UCON = 0x08;
 }
@@ -529,11 +627,20 @@ void usb_init() {
  */
 void usb_process() {
        
-    // auto flush after some idle time
-    if (nosend_counter++ > 200) {
+    // auto flush if oldest pending character reached flush timeout
+    if ((txbuffer_writepos > 0) && ((unsigned short) (TMR0 - usb_ep1_filltime) >= usb_flush_timeout)) {
         usb_ep1_flush();
     }
 
+    if (UIRbits.SOFIF) {
+        // start of frame: latch frame number together with local clock
+        clock_process();
+        usb_sof_ticks = clock_getFraction();
+        usb_sof_ms = clock_getMS();
+        usb_sof_frame = ((unsigned short) (UFRMH & 0x07) << 8) | UFRML;
+        UIRbits.SOFIF = 0;
+    }
+
     if (UIRbits.TRNIF) {
         // complete interrupt
 
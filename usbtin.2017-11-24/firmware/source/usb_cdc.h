@@ -37,6 +37,13 @@ unsigned char usb_ep1_ready();
 void usb_ep1_flush();
 unsigned char usb_serialNumberAvailable();
 unsigned char usb_isConfigured();
+void usb_ep1_setFlushTimeout(unsigned short ticks);
+void usb_ep1_probe(unsigned short tick);
+unsigned short usb_ep1_getLatencyCount(unsigned char bin);
+void usb_ep1_clearLatency();
+unsigned short usb_getFrameNumber(unsigned short * ms, unsigned short * ticks);
+
+#define USB_LATENCY_BINS 8
 
 const unsigned char usb_string_serial[] @ 0x0300;
 
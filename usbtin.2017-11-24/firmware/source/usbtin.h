@@ -59,6 +59,26 @@
                     Added command 'fx' for error status reporting
                     Added LED blinking (3x) if USB is not enumerated/configured
                     Added selftest. LED blinking on failure (7x)
+  1.9   2026-10-19  Flush usb buffer on timer deadline (was main loop counter)
+                    Added command 'U' to select usb flush mode (latency/deadline/throughput)
+                    Added command 'u' for usb latency statistics
+                    Clock catches up if processed late
+                    Added command 'Y' to latch usb frame number with clock (once or periodic)
+                    Added profiler for hot paths, build with PROFILE=1 (commands 'P' and 'p')
+                    Profile main loop stages with histograms, build with PROFILE=2 (command 'H')
+                    Added rx buffer high-water mark and endpoint 1 busy count (command 'P'
+                    without argument, cleared by 'p')
+                    Profiling builds use a command line buffer of 32 to fit into ram
+                    Faster hex decoding of transmit commands (no 32 bit arithmetic for data bytes)
+                    Added command 'q' to get count of free transmit buffers
+                    Fixed timestamp wrap (was 0..60000, now 0..59999)
+                    Clock reset on 'O' does not reset timer 0 anymore
+                    Increased bulk out packet size (now 16, was 8)
+                    Added command 'c' to get count of received messages and of messages loaded into transmit buffers
+                    Added commands 'k' and 'K' to set MCP2515 masks and filters with 29 bit identifiers
+                    Added fine timestamps with 4 us resolution (command 'Z2')
+                    Keep usb state in usb ram not used by the SIE and pack dlc into frame flags
+                    to make room in ram
 
  ********************************************************************/
 #ifndef _USBTIN_
@@ -67,7 +87,7 @@
 #define VERSION_HARDWARE_MAJOR 1
 #define VERSION_HARDWARE_MINOR 0
 #define VERSION_FIRMWARE_MAJOR 1
-#define VERSION_FIRMWARE_MINOR 8
+#define VERSION_FIRMWARE_MINOR 9
 
 #define CANMSG_BUFFERSIZE 16
 